@@ -0,0 +1,308 @@
+//! \file aes.cpp
+//! \brief Source of AES block cipher and AES-CMAC classes.
+#include <cstring>
+
+#include "aes.h"
+
+namespace
+{
+ //! \struct Tables
+ //! \brief AES S-boxes and round lookup tables, generated once on first use.
+ struct Tables
+ {
+  quint8 sbox[256];//!< S-box
+  quint8 invSbox[256];//!< Inverse S-box
+  quint32 te[4][256];//!< Encryption round tables, SubBytes and MixColumns
+  quint32 td[4][256];//!< Decryption round tables, InvSubBytes and InvMixColumns
+
+  //! \fn quint8 Tables::mul(quint8 a, quint8 b)
+  //! \brief Multiplication in GF(2^8).
+  static quint8 mul(quint8 a, quint8 b)
+  {
+   quint8 result = 0;
+   while (b != 0)
+   {
+    if (b & 1)
+     result ^= a;
+    a = static_cast<quint8>((a << 1) ^ ((a & 0x80) ? 0x1B : 0));
+    b >>= 1;
+   }
+   return result;
+  }
+
+  //! \fn quint8 Tables::rotl8(quint8 x, int shift)
+  //! \brief Rotates byte left.
+  static quint8 rotl8(quint8 x, int shift)
+  {
+   return static_cast<quint8>((x << shift) | (x >> (8 - shift)));
+  }
+
+  //! \fn quint32 Tables::ror32(quint32 x, int shift)
+  //! \brief Rotates word right.
+  static quint32 ror32(quint32 x, int shift)
+  {
+   return (x >> shift) | (x << (32 - shift));
+  }
+
+  Tables()
+  {
+   //p runs over all non-zero elements multiplying by 3, q is inverse of p
+   quint8 p = 1, q = 1;
+   do
+   {
+    p = static_cast<quint8>(p ^ (p << 1) ^ ((p & 0x80) ? 0x1B : 0));
+    q ^= static_cast<quint8>(q << 1);
+    q ^= static_cast<quint8>(q << 2);
+    q ^= static_cast<quint8>(q << 4);
+    if (q & 0x80)
+     q ^= 0x09;
+    sbox[p] = static_cast<quint8>(q ^ rotl8(q, 1) ^ rotl8(q, 2) ^ rotl8(q, 3) ^ rotl8(q, 4) ^ 0x63);
+   } while (p != 1);
+   sbox[0] = 0x63;
+   for (int i = 0; i < 256; ++i)
+    invSbox[sbox[i]] = static_cast<quint8>(i);
+   for (int i = 0; i < 256; ++i)
+   {
+    quint8 s = sbox[i];
+    quint8 is = invSbox[i];
+    te[0][i] = static_cast<quint32>(mul(s, 2)) << 24 | static_cast<quint32>(s) << 16 | static_cast<quint32>(s) << 8 | mul(s, 3);
+    td[0][i] = static_cast<quint32>(mul(is, 0x0E)) << 24 | static_cast<quint32>(mul(is, 0x09)) << 16 | static_cast<quint32>(mul(is, 0x0D)) << 8 | mul(is, 0x0B);
+    for (int t = 1; t < 4; ++t)
+    {
+     te[t][i] = ror32(te[0][i], 8 * t);
+     td[t][i] = ror32(td[0][i], 8 * t);
+    }
+   }
+  }
+ };
+
+ //! \fn const Tables& tables(void)
+ //! \brief Returns lookup tables.
+ const Tables& tables()
+ {
+  static const Tables instance;
+  return instance;
+ }
+
+ //! \fn quint32 load32(const quint8 *p)
+ //! \brief Loads big-endian word.
+ quint32 load32(const quint8 *p)
+ {
+  return static_cast<quint32>(p[0]) << 24 | static_cast<quint32>(p[1]) << 16 | static_cast<quint32>(p[2]) << 8 | p[3];
+ }
+
+ //! \fn void store32(quint8 *p, quint32 x)
+ //! \brief Stores big-endian word.
+ void store32(quint8 *p, quint32 x)
+ {
+  p[0] = static_cast<quint8>(x >> 24);
+  p[1] = static_cast<quint8>(x >> 16);
+  p[2] = static_cast<quint8>(x >> 8);
+  p[3] = static_cast<quint8>(x);
+ }
+
+ //! \fn void xorBlock(quint8 *out, const quint8 *in)
+ //! \brief Xors block into out block.
+ void xorBlock(quint8 *out, const quint8 *in)
+ {
+  for (int i = 0; i < Crypto::AES_BLOCK_SIZE; ++i)
+   out[i] ^= in[i];
+ }
+
+ //! \fn void doubleBlock(const quint8 *in, quint8 *out)
+ //! \brief Multiplies block by x in GF(2^128), used for CMAC subkeys.
+ void doubleBlock(const quint8 *in, quint8 *out)
+ {
+  quint8 carry = in[0] >> 7;
+  for (int i = 0; i < Crypto::AES_BLOCK_SIZE - 1; ++i)
+   out[i] = static_cast<quint8>((in[i] << 1) | (in[i + 1] >> 7));
+  out[Crypto::AES_BLOCK_SIZE - 1] = static_cast<quint8>((in[Crypto::AES_BLOCK_SIZE - 1] << 1) ^ (carry ? 0x87 : 0));
+ }
+}
+
+bool Crypto::AES::setKey(const QByteArray& key)
+{
+ int keyWords = key.size() / 4;
+ if (key.size() != 16 && key.size() != 24 && key.size() != 32)
+  return false;
+ const Tables& t = tables();
+ const quint8 *k = reinterpret_cast<const quint8*>(key.constData());
+ rounds = keyWords + 6;
+ int totalWords = 4 * (rounds + 1);
+ for (int i = 0; i < keyWords; ++i)
+  encKeys[i] = load32(k + 4 * i);
+ quint8 rcon = 1;
+ for (int i = keyWords; i < totalWords; ++i)
+ {
+  quint32 w = encKeys[i - 1];
+  if (i % keyWords == 0)
+  {
+   w = (w << 8) | (w >> 24);
+   w = static_cast<quint32>(t.sbox[w >> 24]) << 24 | static_cast<quint32>(t.sbox[(w >> 16) & 0xFF]) << 16
+    | static_cast<quint32>(t.sbox[(w >> 8) & 0xFF]) << 8 | t.sbox[w & 0xFF];
+   w ^= static_cast<quint32>(rcon) << 24;
+   rcon = Tables::mul(rcon, 2);
+  }
+  else if (keyWords > 6 && i % keyWords == 4)
+  {
+   w = static_cast<quint32>(t.sbox[w >> 24]) << 24 | static_cast<quint32>(t.sbox[(w >> 16) & 0xFF]) << 16
+    | static_cast<quint32>(t.sbox[(w >> 8) & 0xFF]) << 8 | t.sbox[w & 0xFF];
+  }
+  encKeys[i] = encKeys[i - keyWords] ^ w;
+ }
+ //Equivalent inverse cipher: reversed round keys, InvMixColumns applied to inner rounds
+ for (int r = 0; r <= rounds; ++r)
+ {
+  for (int j = 0; j < 4; ++j)
+  {
+   quint32 w = encKeys[4 * (rounds - r) + j];
+   if (r != 0 && r != rounds)
+    w = t.td[0][t.sbox[w >> 24]] ^ t.td[1][t.sbox[(w >> 16) & 0xFF]] ^ t.td[2][t.sbox[(w >> 8) & 0xFF]] ^ t.td[3][t.sbox[w & 0xFF]];
+   decKeys[4 * r + j] = w;
+  }
+ }
+ return true;
+}
+
+void Crypto::AES::encryptBlock(const quint8* in, quint8* out) const
+{
+ const Tables& t = tables();
+ const quint32 *rk = encKeys;
+ quint32 s0 = load32(in) ^ rk[0];
+ quint32 s1 = load32(in + 4) ^ rk[1];
+ quint32 s2 = load32(in + 8) ^ rk[2];
+ quint32 s3 = load32(in + 12) ^ rk[3];
+ for (int r = 1; r < rounds; ++r)
+ {
+  rk += 4;
+  quint32 t0 = t.te[0][s0 >> 24] ^ t.te[1][(s1 >> 16) & 0xFF] ^ t.te[2][(s2 >> 8) & 0xFF] ^ t.te[3][s3 & 0xFF] ^ rk[0];
+  quint32 t1 = t.te[0][s1 >> 24] ^ t.te[1][(s2 >> 16) & 0xFF] ^ t.te[2][(s3 >> 8) & 0xFF] ^ t.te[3][s0 & 0xFF] ^ rk[1];
+  quint32 t2 = t.te[0][s2 >> 24] ^ t.te[1][(s3 >> 16) & 0xFF] ^ t.te[2][(s0 >> 8) & 0xFF] ^ t.te[3][s1 & 0xFF] ^ rk[2];
+  quint32 t3 = t.te[0][s3 >> 24] ^ t.te[1][(s0 >> 16) & 0xFF] ^ t.te[2][(s1 >> 8) & 0xFF] ^ t.te[3][s2 & 0xFF] ^ rk[3];
+  s0 = t0;
+  s1 = t1;
+  s2 = t2;
+  s3 = t3;
+ }
+ rk += 4;
+ const quint8 *sb = t.sbox;
+ store32(out, (static_cast<quint32>(sb[s0 >> 24]) << 24 | static_cast<quint32>(sb[(s1 >> 16) & 0xFF]) << 16
+  | static_cast<quint32>(sb[(s2 >> 8) & 0xFF]) << 8 | sb[s3 & 0xFF]) ^ rk[0]);
+ store32(out + 4, (static_cast<quint32>(sb[s1 >> 24]) << 24 | static_cast<quint32>(sb[(s2 >> 16) & 0xFF]) << 16
+  | static_cast<quint32>(sb[(s3 >> 8) & 0xFF]) << 8 | sb[s0 & 0xFF]) ^ rk[1]);
+ store32(out + 8, (static_cast<quint32>(sb[s2 >> 24]) << 24 | static_cast<quint32>(sb[(s3 >> 16) & 0xFF]) << 16
+  | static_cast<quint32>(sb[(s0 >> 8) & 0xFF]) << 8 | sb[s1 & 0xFF]) ^ rk[2]);
+ store32(out + 12, (static_cast<quint32>(sb[s3 >> 24]) << 24 | static_cast<quint32>(sb[(s0 >> 16) & 0xFF]) << 16
+  | static_cast<quint32>(sb[(s1 >> 8) & 0xFF]) << 8 | sb[s2 & 0xFF]) ^ rk[3]);
+}
+
+void Crypto::AES::decryptBlock(const quint8* in, quint8* out) const
+{
+ const Tables& t = tables();
+ const quint32 *rk = decKeys;
+ quint32 s0 = load32(in) ^ rk[0];
+ quint32 s1 = load32(in + 4) ^ rk[1];
+ quint32 s2 = load32(in + 8) ^ rk[2];
+ quint32 s3 = load32(in + 12) ^ rk[3];
+ for (int r = 1; r < rounds; ++r)
+ {
+  rk += 4;
+  quint32 t0 = t.td[0][s0 >> 24] ^ t.td[1][(s3 >> 16) & 0xFF] ^ t.td[2][(s2 >> 8) & 0xFF] ^ t.td[3][s1 & 0xFF] ^ rk[0];
+  quint32 t1 = t.td[0][s1 >> 24] ^ t.td[1][(s0 >> 16) & 0xFF] ^ t.td[2][(s3 >> 8) & 0xFF] ^ t.td[3][s2 & 0xFF] ^ rk[1];
+  quint32 t2 = t.td[0][s2 >> 24] ^ t.td[1][(s1 >> 16) & 0xFF] ^ t.td[2][(s0 >> 8) & 0xFF] ^ t.td[3][s3 & 0xFF] ^ rk[2];
+  quint32 t3 = t.td[0][s3 >> 24] ^ t.td[1][(s2 >> 16) & 0xFF] ^ t.td[2][(s1 >> 8) & 0xFF] ^ t.td[3][s0 & 0xFF] ^ rk[3];
+  s0 = t0;
+  s1 = t1;
+  s2 = t2;
+  s3 = t3;
+ }
+ rk += 4;
+ const quint8 *isb = t.invSbox;
+ store32(out, (static_cast<quint32>(isb[s0 >> 24]) << 24 | static_cast<quint32>(isb[(s3 >> 16) & 0xFF]) << 16
+  | static_cast<quint32>(isb[(s2 >> 8) & 0xFF]) << 8 | isb[s1 & 0xFF]) ^ rk[0]);
+ store32(out + 4, (static_cast<quint32>(isb[s1 >> 24]) << 24 | static_cast<quint32>(isb[(s0 >> 16) & 0xFF]) << 16
+  | static_cast<quint32>(isb[(s3 >> 8) & 0xFF]) << 8 | isb[s2 & 0xFF]) ^ rk[1]);
+ store32(out + 8, (static_cast<quint32>(isb[s2 >> 24]) << 24 | static_cast<quint32>(isb[(s1 >> 16) & 0xFF]) << 16
+  | static_cast<quint32>(isb[(s0 >> 8) & 0xFF]) << 8 | isb[s3 & 0xFF]) ^ rk[2]);
+ store32(out + 12, (static_cast<quint32>(isb[s3 >> 24]) << 24 | static_cast<quint32>(isb[(s2 >> 16) & 0xFF]) << 16
+  | static_cast<quint32>(isb[(s1 >> 8) & 0xFF]) << 8 | isb[s0 & 0xFF]) ^ rk[3]);
+}
+
+void Crypto::AES::encryptCBC(const quint8* iv, quint8* data, int size) const
+{
+ const quint8 *previous = iv;
+ for (int offset = 0; offset + AES_BLOCK_SIZE <= size; offset += AES_BLOCK_SIZE)
+ {
+  quint8 *current = data + offset;
+  xorBlock(current, previous);
+  encryptBlock(current, current);
+  previous = current;
+ }
+}
+
+void Crypto::AES::decryptCBC(const quint8* iv, quint8* data, int size) const
+{
+ quint8 previous[AES_BLOCK_SIZE];
+ quint8 cipherBlock[AES_BLOCK_SIZE];
+ std::memcpy(previous, iv, AES_BLOCK_SIZE);
+ for (int offset = 0; offset + AES_BLOCK_SIZE <= size; offset += AES_BLOCK_SIZE)
+ {
+  quint8 *current = data + offset;
+  std::memcpy(cipherBlock, current, AES_BLOCK_SIZE);
+  decryptBlock(current, current);
+  xorBlock(current, previous);
+  std::memcpy(previous, cipherBlock, AES_BLOCK_SIZE);
+ }
+}
+
+bool Crypto::CMAC::setKey(const QByteArray& key)
+{
+ if (!cipher.setKey(key))
+  return false;
+ quint8 l[AES_BLOCK_SIZE] = {};
+ cipher.encryptBlock(l, l);
+ doubleBlock(l, k1);
+ doubleBlock(k1, k2);
+ reset();
+ return true;
+}
+
+void Crypto::CMAC::reset()
+{
+ std::memset(state, 0, AES_BLOCK_SIZE);
+ blockSize = 0;
+}
+
+void Crypto::CMAC::update(const quint8* data, int size)
+{
+ while (size > 0)
+ {
+  //Full pending block is processed only when more data follows, last block is processed in final()
+  if (blockSize == AES_BLOCK_SIZE)
+  {
+   xorBlock(state, block);
+   cipher.encryptBlock(state, state);
+   blockSize = 0;
+  }
+  int count = qMin(size, AES_BLOCK_SIZE - blockSize);
+  std::memcpy(block + blockSize, data, count);
+  blockSize += count;
+  data += count;
+  size -= count;
+ }
+}
+
+void Crypto::CMAC::final(quint8* mac)
+{
+ if (blockSize == AES_BLOCK_SIZE)
+  xorBlock(block, k1);
+ else
+ {
+  block[blockSize] = 0x80;
+  std::memset(block + blockSize + 1, 0, AES_BLOCK_SIZE - blockSize - 1);
+  xorBlock(block, k2);
+ }
+ xorBlock(state, block);
+ cipher.encryptBlock(state, mac);
+ reset();
+}
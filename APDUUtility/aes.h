@@ -0,0 +1,79 @@
+//! \file aes.h
+//! \brief Header file for AES block cipher and AES-CMAC classes.
+#ifndef AES_H
+#define AES_H
+
+#include <QByteArray>
+
+namespace Crypto
+{
+ const int AES_BLOCK_SIZE = 16;//!< AES block size in bytes
+
+ //! \class AES
+ //! \brief AES block cipher (FIPS-197) with 128, 192 or 256 bit key.
+ //! \details Encryption and decryption key schedules are expanded once in setKey(), so blocks are processed without allocations.
+ class AES
+ {
+ public:
+  //! \fn bool AES::setKey(const QByteArray& key)
+  //! \brief Expands key schedules.
+  //! \param[in] key 16, 24 or 32 bytes key.
+  //! \return false if key size is not supported.
+  bool setKey(const QByteArray& key);
+  //! \fn void AES::encryptBlock(const quint8 *in, quint8 *out) const
+  //! \brief Encrypts one block. In and out may point to the same block.
+  void encryptBlock(const quint8 *in, quint8 *out) const;
+  //! \fn void AES::decryptBlock(const quint8 *in, quint8 *out) const
+  //! \brief Decrypts one block. In and out may point to the same block.
+  void decryptBlock(const quint8 *in, quint8 *out) const;
+  //! \fn void AES::encryptCBC(const quint8 *iv, quint8 *data, int size) const
+  //! \brief Encrypts data in place in CBC mode.
+  //! \param[in] iv initial vector, one block.
+  //! \param[in,out] data data to encrypt, size must be multiple of block size.
+  //! \param[in] size data size.
+  void encryptCBC(const quint8 *iv, quint8 *data, int size) const;
+  //! \fn void AES::decryptCBC(const quint8 *iv, quint8 *data, int size) const
+  //! \brief Decrypts data in place in CBC mode.
+  //! \param[in] iv initial vector, one block.
+  //! \param[in,out] data data to decrypt, size must be multiple of block size.
+  //! \param[in] size data size.
+  void decryptCBC(const quint8 *iv, quint8 *data, int size) const;
+ private:
+  quint32 encKeys[60]{};//!< Encryption key schedule
+  quint32 decKeys[60]{};//!< Decryption key schedule for equivalent inverse cipher
+  int rounds{ 0 };//!< Count of rounds, 0 if key is not set
+ };
+
+ //! \class CMAC
+ //! \brief AES-CMAC (NIST SP 800-38B) with incremental input.
+ class CMAC
+ {
+ public:
+  //! \fn bool CMAC::setKey(const QByteArray& key)
+  //! \brief Expands cipher key schedule and computes subkeys.
+  //! \return false if key size is not supported.
+  bool setKey(const QByteArray& key);
+  //! \fn void CMAC::reset(void)
+  //! \brief Starts new MAC computation with the same key.
+  void reset(void);
+  //! \fn void CMAC::update(const quint8 *data, int size)
+  //! \brief Adds data to MAC computation.
+  void update(const quint8 *data, int size);
+  //! \fn void CMAC::update(const QByteArray& data)
+  //! \brief Adds data to MAC computation.
+  void update(const QByteArray& data) { update(reinterpret_cast<const quint8*>(data.constData()), data.size()); }
+  //! \fn void CMAC::final(quint8 *mac)
+  //! \brief Finishes MAC computation.
+  //! \param[out] mac MAC, one block.
+  void final(quint8 *mac);
+ private:
+  AES cipher;//!< Cipher with expanded key schedule
+  quint8 k1[AES_BLOCK_SIZE]{};//!< Subkey for complete last block
+  quint8 k2[AES_BLOCK_SIZE]{};//!< Subkey for padded last block
+  quint8 state[AES_BLOCK_SIZE]{};//!< CBC state
+  quint8 block[AES_BLOCK_SIZE]{};//!< Pending input block, processed when more data is added
+  int blockSize{ 0 };//!< Size of pending input block
+ };
+}
+
+#endif // AES_H
@@ -0,0 +1,169 @@
+//! \file apdumetrics.cpp
+//! \brief Source of reader and card metrics registry.
+#include <functional>
+#include <QSaveFile>
+#include <QTextStream>
+
+#include "apdumetrics.h"
+
+namespace
+{
+ //! \fn QString escapeLabel(const QString& value)
+ //! \brief Escapes label value for Prometheus text format.
+ QString escapeLabel(const QString& value)
+ {
+  QString escaped(value);
+  escaped.replace('\\', "\\\\");
+  escaped.replace('"', "\\\"");
+  escaped.replace('\n', "\\n");
+  return escaped;
+ }
+
+ //! \fn void writeHeader(QTextStream& out, const char* name, const char* help, const char* type)
+ //! \brief Writes HELP and TYPE lines of metric family.
+ void writeHeader(QTextStream& out, const char* name, const char* help, const char* type)
+ {
+  out << "# HELP " << name << ' ' << help << '\n';
+  out << "# TYPE " << name << ' ' << type << '\n';
+ }
+}
+
+Metrics::ReaderMetrics::ReaderMetrics(const QString& readerName) : readerName(readerName)
+{
+}
+
+void Metrics::ReaderMetrics::connected()
+{
+ connects.fetch_add(1, std::memory_order_relaxed);
+ if (connectionLost.exchange(false, std::memory_order_relaxed))
+  reconnects.fetch_add(1, std::memory_order_relaxed);
+ isConnected.store(1, std::memory_order_relaxed);
+}
+
+void Metrics::ReaderMetrics::connectFailed()
+{
+ connectFailures.fetch_add(1, std::memory_order_relaxed);
+ isConnected.store(0, std::memory_order_relaxed);
+}
+
+void Metrics::ReaderMetrics::disconnected()
+{
+ isConnected.store(0, std::memory_order_relaxed);
+}
+
+void Metrics::ReaderMetrics::transmitted(quint8 sw1, quint64 elapsedUs)
+{
+ transmits.fetch_add(1, std::memory_order_relaxed);
+ transmitMicroseconds.fetch_add(elapsedUs, std::memory_order_relaxed);
+ sw1Counts[sw1].fetch_add(1, std::memory_order_relaxed);
+ isConnected.store(1, std::memory_order_relaxed);
+}
+
+void Metrics::ReaderMetrics::transmitFailed(quint64 elapsedUs, bool cardLost)
+{
+ transmitFailures.fetch_add(1, std::memory_order_relaxed);
+ transmitMicroseconds.fetch_add(elapsedUs, std::memory_order_relaxed);
+ if (!cardLost)
+  return;
+ //Card removed or reset, the following connect is a reconnect
+ isConnected.store(0, std::memory_order_relaxed);
+ connectionLost.store(true, std::memory_order_relaxed);
+}
+
+Metrics::ReaderMetrics* Metrics::MetricsRegistry::reader(const QString& readerName)
+{
+ {
+  QReadLocker locker(&lock);
+  auto it = readers.constFind(readerName);
+  if (it != readers.constEnd())
+   return it.value().data();
+ }
+ QWriteLocker locker(&lock);
+ QSharedPointer<ReaderMetrics>& metrics = readers[readerName];
+ if (metrics.isNull())
+  metrics.reset(new ReaderMetrics(readerName));
+ return metrics.data();
+}
+
+void Metrics::MetricsRegistry::contextFailed()
+{
+ contextFailures.fetch_add(1, std::memory_order_relaxed);
+}
+
+QByteArray Metrics::MetricsRegistry::toPrometheusText() const
+{
+ QByteArray text;
+ QTextStream out(&text, QIODevice::WriteOnly);
+ //Textfile collector rejects whole file with invalid UTF-8, default codec is ANSI code page on Windows
+ out.setCodec("UTF-8");
+ QReadLocker locker(&lock);
+ //Writes one sample per reader for metric family
+ auto writeReaders = [&](const char* name, const std::function<quint64(const ReaderMetrics&)>& value)
+ {
+  for (const QSharedPointer<ReaderMetrics>& metrics : readers)
+   out << name << "{reader=\"" << escapeLabel(metrics->readerName) << "\"} " << value(*metrics) << '\n';
+ };
+ writeHeader(out, "apdu_transmit_total", "APDU commands exchanged with response.", "counter");
+ writeReaders("apdu_transmit_total", [](const ReaderMetrics& m) { return m.transmits.load(std::memory_order_relaxed); });
+ writeHeader(out, "apdu_transmit_failures_total", "APDU commands failed with smart card exception.", "counter");
+ writeReaders("apdu_transmit_failures_total", [](const ReaderMetrics& m) { return m.transmitFailures.load(std::memory_order_relaxed); });
+ writeHeader(out, "apdu_responses_total", "APDU responses by first status word byte.", "counter");
+ for (const QSharedPointer<ReaderMetrics>& metrics : readers)
+ {
+  for (int sw1 = 0; sw1 < 256; ++sw1)
+  {
+   quint64 count = metrics->sw1Counts[sw1].load(std::memory_order_relaxed);
+   if (count == 0)
+    continue;
+   out << "apdu_responses_total{reader=\"" << escapeLabel(metrics->readerName) << "\",sw1=\""
+       << QString::number(sw1, 16).rightJustified(2, '0').toUpper() << "\"} " << count << '\n';
+  }
+ }
+ writeHeader(out, "apdu_error_responses_total", "APDU responses with ISO 7816-4 error status word (SW1 64-6F).", "counter");
+ writeReaders("apdu_error_responses_total", [](const ReaderMetrics& m)
+ {
+  quint64 count = 0;
+  for (int sw1 = 0x64; sw1 <= 0x6F; ++sw1)
+   count += m.sw1Counts[sw1].load(std::memory_order_relaxed);
+  return count;
+ });
+ writeHeader(out, "apdu_transmit_duration_seconds", "Duration of APDU exchanges.", "summary");
+ for (const QSharedPointer<ReaderMetrics>& metrics : readers)
+ {
+  QString label = escapeLabel(metrics->readerName);
+  quint64 count = metrics->transmits.load(std::memory_order_relaxed) + metrics->transmitFailures.load(std::memory_order_relaxed);
+  out << "apdu_transmit_duration_seconds_sum{reader=\"" << label << "\"} "
+      << QString::number(metrics->transmitMicroseconds.load(std::memory_order_relaxed) / 1e6, 'f', 6) << '\n';
+  out << "apdu_transmit_duration_seconds_count{reader=\"" << label << "\"} " << count << '\n';
+ }
+ writeHeader(out, "apdu_connects_total", "Successful connects to reader.", "counter");
+ writeReaders("apdu_connects_total", [](const ReaderMetrics& m) { return m.connects.load(std::memory_order_relaxed); });
+ writeHeader(out, "apdu_reconnects_total", "Connects after connection was lost with card removal, reset or reader failure.", "counter");
+ writeReaders("apdu_reconnects_total", [](const ReaderMetrics& m) { return m.reconnects.load(std::memory_order_relaxed); });
+ writeHeader(out, "apdu_connect_failures_total", "Failed connects to reader.", "counter");
+ writeReaders("apdu_connect_failures_total", [](const ReaderMetrics& m) { return m.connectFailures.load(std::memory_order_relaxed); });
+ writeHeader(out, "apdu_reader_connected", "Whether card in reader is connected.", "gauge");
+ writeReaders("apdu_reader_connected", [](const ReaderMetrics& m) { return static_cast<quint64>(m.isConnected.load(std::memory_order_relaxed)); });
+ writeHeader(out, "apdu_context_failures_total", "Failed establish context calls.", "counter");
+ out << "apdu_context_failures_total " << contextFailures.load(std::memory_order_relaxed) << '\n';
+ out.flush();
+ return text;
+}
+
+bool Metrics::MetricsRegistry::writeTextfile(const QString& filePath, QString& err) const
+{
+ //QSaveFile writes into temporary file and renames it, so collector never reads partial file
+ QSaveFile saveFile(filePath);
+ if (!saveFile.open(QIODevice::WriteOnly))
+ {
+  err = saveFile.errorString();
+  return false;
+ }
+ saveFile.write(toPrometheusText());
+ if (!saveFile.commit())
+ {
+  err = saveFile.errorString();
+  return false;
+ }
+ return true;
+}
@@ -0,0 +1,87 @@
+//! \file apdumetrics.h
+//! \brief Header file for reader and card metrics registry.
+#ifndef APDUMETRICS_H
+#define APDUMETRICS_H
+
+#include <atomic>
+#include <QMap>
+#include <QReadWriteLock>
+#include <QSharedPointer>
+#include <QString>
+
+namespace Metrics
+{
+ //! \class ReaderMetrics
+ //! \brief Counters and gauges of one reader.
+ //! \details All updates are relaxed atomic operations, so the transmit path never takes a lock.
+ class ReaderMetrics
+ {
+ public:
+  //!\brief Constructor
+  //!\param[in] readerName name of reader, used as label value.
+  explicit ReaderMetrics(const QString& readerName);
+  //! \fn void ReaderMetrics::connected(void)
+  //! \brief Register successful connect to reader.
+  //! \details Counted as reconnect, if previous connection was lost with card.
+  void connected(void);
+  //! \fn void ReaderMetrics::connectFailed(void)
+  //! \brief Register failed connect to reader.
+  void connectFailed(void);
+  //! \fn void ReaderMetrics::disconnected(void)
+  //! \brief Register user disconnect from reader. It is not a lost connection, so it is not followed by reconnect.
+  void disconnected(void);
+  //! \fn void ReaderMetrics::transmitted(quint8 sw1, quint64 elapsedUs)
+  //! \brief Register APDU exchange completed with response.
+  //! \param[in] sw1 first byte of response status word.
+  //! \param[in] elapsedUs exchange duration in microseconds.
+  void transmitted(quint8 sw1, quint64 elapsedUs);
+  //! \fn void ReaderMetrics::transmitFailed(quint64 elapsedUs, bool cardLost)
+  //! \brief Register APDU exchange failed with exception.
+  //! \param[in] elapsedUs exchange duration in microseconds.
+  //! \param[in] cardLost card was removed, reset or unpowered, or reader became unavailable.
+  //! Other failures leave connection and gauge unchanged.
+  void transmitFailed(quint64 elapsedUs, bool cardLost);
+ private:
+  friend class MetricsRegistry;
+  QString readerName;//!< Reader name
+  std::atomic<quint64> transmits{ 0 };//!< Count of APDU exchanges completed with response
+  std::atomic<quint64> transmitFailures{ 0 };//!< Count of APDU exchanges failed with exception
+  std::atomic<quint64> transmitMicroseconds{ 0 };//!< Total duration of APDU exchanges
+  std::atomic<quint64> connects{ 0 };//!< Count of successful connects
+  std::atomic<quint64> reconnects{ 0 };//!< Count of connects after lost connection
+  std::atomic<quint64> connectFailures{ 0 };//!< Count of failed connects
+  std::atomic<int> isConnected{ 0 };//!< Connected gauge
+  std::atomic<bool> connectionLost{ false };//!< Connection was lost with card
+  std::atomic<quint64> sw1Counts[256]{};//!< Count of responses by SW1
+ };
+
+ //! \class MetricsRegistry
+ //! \brief Registry of readers metrics, exported in Prometheus text format.
+ class MetricsRegistry
+ {
+ public:
+  //! \fn ReaderMetrics* MetricsRegistry::reader(const QString& readerName)
+  //! \brief Returns metrics of reader, creates it on first use.
+  //! \details Returned pointer stays valid for registry lifetime, callers may cache it.
+  //! \param[in] readerName name of reader.
+  ReaderMetrics* reader(const QString& readerName);
+  //! \fn void MetricsRegistry::contextFailed(void)
+  //! \brief Register failed establish context call.
+  void contextFailed(void);
+  //! \fn QByteArray MetricsRegistry::toPrometheusText(void) const
+  //! \brief Returns all metrics in Prometheus text exposition format.
+  QByteArray toPrometheusText(void) const;
+  //! \fn bool MetricsRegistry::writeTextfile(const QString& filePath, QString& err) const
+  //! \brief Atomically rewrites metrics file for node-exporter textfile collector.
+  //! \param[in] filePath path to *.prom file.
+  //! \param[out] err error string, if write failed.
+  //! \return true on success.
+  bool writeTextfile(const QString& filePath, QString& err) const;
+ private:
+  mutable QReadWriteLock lock;//!< Guards readers map, taken only on lookup and export
+  QMap<QString, QSharedPointer<ReaderMetrics>> readers;//!< Readers metrics by name
+  std::atomic<quint64> contextFailures{ 0 };//!< Count of failed establish context calls
+ };
+}
+
+#endif // APDUMETRICS_H
@@ -6,11 +6,19 @@
 #include <QMessageBox>
 #include <QInputDialog>
 #include <QClipboard>
+#include <QElapsedTimer>
+#include <QFileDialog>
 
 #include "apduutility.h"
 #include "nativescard.h"
 #include "scardexception.h"
 #include "settingswidget.h"
+#include "traceimporter.h"
+
+namespace
+{
+ const int maxAutoLoadCommands = 10000;//!< Larger imported vendor commands lists are not loaded automatically, loading freezes main window
+}
 
 APDUUtility::APDUUtility(QWidget *parent)
     : QMainWindow(parent)
@@ -20,6 +28,7 @@ APDUUtility::APDUUtility(QWidget *parent)
     defaultScope = static_cast<Smartcards::SCOPE>(settings.value("scope", 0).toInt());
     defaultShare = static_cast<Smartcards::SHARE>(settings.value("shareMode", 0).toInt());
     defaultProtocol = static_cast<Smartcards::PROTOCOL>(settings.value("protocol", 0).toInt());
+    metricsFilePath = settings.value("metricsFile", "").toString();
     ui.APDUCommandsListView->setModel(APDUCommandsListModel.data());
     //Load vendors command list files
     QDir vendorsDir(QApplication::applicationDirPath() + "/vendors/","*.json");
@@ -41,6 +50,7 @@ APDUUtility::APDUUtility(QWidget *parent)
     }
     catch (SCardException& e)
     {
+     metrics->contextFailed();
      ui.statusBar->showMessage(e.errorString());
     }
     ui.CLALineEdit->installEventFilter(this);
@@ -59,6 +69,11 @@ APDUUtility::APDUUtility(QWidget *parent)
     if (index > 0)
      ui.vendorCommandsListFileComboBox->setCurrentIndex(index);
     tId = startTimer(1000);
+    if (!metricsFilePath.isEmpty())
+     metricsTId = startTimer(settings.value("metricsInterval", 15).toInt() * 1000);
+    connect(ui.actionImportTrace, SIGNAL(triggered()), this, SLOT(importTrace()));
+    connect(ui.actionOpenSecureChannel, SIGNAL(triggered()), this, SLOT(openSecureChannel()));
+    connect(ui.actionCloseSecureChannel, SIGNAL(triggered()), this, SLOT(closeSecureChannel()));
     connect(ui.actionSettings, SIGNAL(triggered()), this, SLOT(showSettings()));
     connect(ui.actionAbout, SIGNAL(triggered()), this, SLOT(about()));
     connect(ui.actionAbout_Qt, SIGNAL(triggered()), qApp, SLOT(aboutQt()));
@@ -75,16 +90,30 @@ APDUUtility::APDUUtility(QWidget *parent)
 
 APDUUtility::~APDUUtility()
 {
+ stopTraceImport();
  if (tId != 0)
   killTimer(tId);
+ if (metricsTId != 0)
+  killTimer(metricsTId);
  cardIface->ReleaseContext();
 }
 
 void APDUUtility::timerEvent(QTimerEvent* event)
 {
+ if (event->timerId() == metricsTId)
+ {
+  QString err;
+  bool written = metrics->writeTextfile(metricsFilePath, err);
+  //Failure is reported once, so it doesn't hide transmit errors on every tick
+  if (!written && !metricsWriteFailed)
+   ui.statusBar->showMessage("Couldn't write metrics file.\n" + err);
+  metricsWriteFailed = !written;
+  return;
+ }
  //Check readers list
  ui.connectButton->setEnabled((ui.readersNamesComboBox->count()>0));
  ui.transmitButton->setEnabled(!ui.CLALineEdit->text().isEmpty() && !ui.INSLineEdit->text().isEmpty());
+ ui.actionCloseSecureChannel->setEnabled(scpSession->isOpen());
  //Check APDU commands list
  QModelIndex index = ui.APDUCommandsListView->currentIndex();
  if(index.isValid())
@@ -170,23 +199,38 @@ void APDUUtility::about()
 
 void APDUUtility::connectButtonClicked()
 {
+ scpSession->close();
  if (cardIface->isConnected())
+ {
   cardIface->Disconnect(Smartcards::DISCONNECT::Leave);
+  if (readerMetrics != nullptr)
+   readerMetrics->disconnected();
+ }
+ readerMetrics = nullptr;
  QString readerName = ui.readersNamesComboBox->currentText();
  ui.statusBar->clearMessage();
  if (!readerName.isEmpty())
  {
   DWORD state, protocol;
+  Metrics::ReaderMetrics *connectMetrics = metrics->reader(readerName);
   try
   {
    if (cardIface->Connect(readerName, defaultShare, defaultProtocol) != Smartcards::SUCCESS)
+   {
     readerName = "none";
+    connectMetrics->connectFailed();
+   }
    else
+   {
     ui.ATRLabel->setText(cardIface->GetCardStatus(state, protocol).toHex());
+    connectMetrics->connected();
+    readerMetrics = connectMetrics;
+   }
   }
   catch (SCardException& e)
   {
    readerName="none";
+   connectMetrics->connectFailed();
    ui.statusBar->showMessage(e.errorString());
   }
  }
@@ -199,7 +243,18 @@ void APDUUtility::reloadButtonClicked()
  try
  {
   if(!cardIface->isContextEstablished())
-   cardIface->EstablishContext(Smartcards::SCOPE::User);
+  {
+   try
+   {
+    cardIface->EstablishContext(Smartcards::SCOPE::User);
+   }
+   catch (SCardException&)
+   {
+    metrics->contextFailed();
+    throw;
+   }
+  }
+  //ListReaders throws when no readers are available, it is not a context failure
   readersNames = cardIface->ListReaders();
   ui.readersNamesComboBox->clear();
   ui.readersNamesComboBox->addItems(readersNames);
@@ -221,18 +276,35 @@ void APDUUtility::transmitButtonClicked()
  QByteArray data = QByteArray::fromHex(ui.dataPlainTextEdit->toPlainText().toLocal8Bit());
  Smartcards::APDUCommand comm(CLA, INS, P1, P2, data, Le);
  Smartcards::APDUResponse resp;
+ QByteArray respData;
  ui.statusBar->clearMessage();
+ QString err;
+ if (scpSession->isOpen() && !scpSession->wrap(Smartcards::APDUCommand(comm), comm, err))
+ {
+  ui.statusBar->showMessage(err);
+  return;
+ }
  try
  {
-  resp = cardIface->Transmit(comm);
+  resp = transmit(comm);
+  respData = resp.getData();
+  if (!scpSession->unwrap(resp.getSW1(), resp.getSW2(), respData, err))
+  {
+   //Unverified response isn't shown, secure channel can't continue
+   respData.clear();
+   scpSession->close();
+   ui.statusBar->showMessage(err + " SCP03 session is closed.");
+  }
  }
  catch(SCardException& e)
  {
+  //MAC chaining is lost with the command
+  scpSession->close();
   ui.statusBar->showMessage(e.errorString());
  }
  ui.SW1LineEdit->setText(QString::number(resp.getSW1(), 16));
  ui.SW2LineEdit->setText(QString::number(resp.getSW2(), 16));
- ui.resultDataPlainTextEdit->setPlainText(resp.getData().toHex());
+ ui.resultDataPlainTextEdit->setPlainText(respData.toHex());
 }
 
 void APDUUtility::addNewVendorButtonClicked()
@@ -308,6 +380,164 @@ void APDUUtility::APDUCommandsListViewActivated(const QModelIndex& index)
  ui.dataPlainTextEdit->setPlainText(QString(command.getData().toHex()));
 }
 
+void APDUUtility::importTrace()
+{
+ if (importThread != nullptr)
+  return;
+ QString traceFilePath = QFileDialog::getOpenFileName(this, "Import trace", QString(), "Trace logs (*.log *.txt);;USB captures (*.pcap *.pcapng);;All files (*)");
+ if (traceFilePath.isEmpty())
+  return;
+ QString vendor = QInputDialog::getText(this, "Vendor name", "Set vendor name for imported commands:", QLineEdit::Normal, QFileInfo(traceFilePath).baseName());
+ if (vendor.isEmpty())
+  return;
+ if (ui.vendorCommandsListFileComboBox->findText(vendor) >= 0)
+ {
+  ui.statusBar->showMessage("Vendor " + vendor + " already exists.");
+  return;
+ }
+ importVendor = vendor;
+ QDir().mkpath(QApplication::applicationDirPath() + "/vendors/");
+ QString vendorFilePath = QApplication::applicationDirPath() + "/vendors/" + vendor + ".json";
+ TraceImporter *importer = new TraceImporter(traceFilePath, vendorFilePath);
+ importThread = new QThread(this);
+ importer->moveToThread(importThread);
+ importProgress = new QProgressDialog("Importing trace...", "Cancel", 0, 100, this);
+ connect(importThread, SIGNAL(started()), importer, SLOT(run()));
+ connect(importThread, SIGNAL(finished()), importer, SLOT(deleteLater()));
+ connect(importer, SIGNAL(progress(int)), importProgress, SLOT(setValue(int)));
+ connect(importer, SIGNAL(finished(int, int)), this, SLOT(traceImportFinished(int, int)));
+ connect(importer, SIGNAL(failed(const QString&)), this, SLOT(traceImportFailed(const QString&)));
+ connect(importProgress, SIGNAL(canceled()), this, SLOT(traceImportCanceled()));
+ importThread->start();
+}
+
+void APDUUtility::traceImportFinished(int commandsCount, int duplicatesCount)
+{
+ stopTraceImport();
+ QString message = QString("Imported %1 commands, %2 duplicates skipped.").arg(commandsCount).arg(duplicatesCount);
+ if (commandsCount > maxAutoLoadCommands)
+ {
+  //Vendor is added without loading, so current list stays selected
+  ui.vendorCommandsListFileComboBox->blockSignals(true);
+  ui.vendorCommandsListFileComboBox->addItem(importVendor);
+  ui.vendorCommandsListFileComboBox->setCurrentIndex(lastVendorIndex);
+  ui.vendorCommandsListFileComboBox->blockSignals(false);
+  ui.statusBar->showMessage(message + " Vendor " + importVendor + " is too large to load automatically, select it to load.");
+  return;
+ }
+ ui.vendorCommandsListFileComboBox->addItem(importVendor);
+ ui.vendorCommandsListFileComboBox->setCurrentIndex(ui.vendorCommandsListFileComboBox->findText(importVendor));
+ ui.statusBar->showMessage(message);
+}
+
+void APDUUtility::traceImportFailed(const QString& err)
+{
+ stopTraceImport();
+ ui.statusBar->showMessage(err);
+}
+
+void APDUUtility::traceImportCanceled()
+{
+ if (importThread != nullptr)
+  importThread->requestInterruption();
+}
+
+void APDUUtility::openSecureChannel()
+{
+ bool ok = false;
+ QString keys = QInputDialog::getText(this, "SCP03 keys", "Static ENC and MAC keys (hex, separated by space):", QLineEdit::Normal,
+  "404142434445464748494A4B4C4D4E4F 404142434445464748494A4B4C4D4E4F", &ok);
+ if (!ok || keys.isEmpty())
+  return;
+ QStringList keysList = keys.split(' ', QString::SkipEmptyParts);
+ QByteArray encKey = QByteArray::fromHex(keysList.value(0).toLocal8Bit());
+ QByteArray macKey = keysList.count() > 1 ? QByteArray::fromHex(keysList.at(1).toLocal8Bit()) : encKey;
+ QSettings settings;
+ int keyVersion = QInputDialog::getInt(this, "SCP03 key version", "Key version number (0 - default keys):", settings.value("scpKeyVersion", 0).toInt(), 0, 255, 1, &ok);
+ if (!ok)
+  return;
+ QStringList levels{ "C-MAC", "C-MAC, C-DECRYPTION", "C-MAC, R-MAC", "C-MAC, C-DECRYPTION, R-MAC", "C-MAC, C-DECRYPTION, R-MAC, R-ENCRYPTION" };
+ const BYTE levelValues[] = { 0x01, 0x03, 0x11, 0x13, 0x33 };
+ QString level = QInputDialog::getItem(this, "SCP03 security level", "Security level:", levels, settings.value("scpSecurityLevel", 0).toInt(), false, &ok);
+ int levelIndex = levels.indexOf(level);
+ if (!ok || levelIndex < 0)
+  return;
+ settings.setValue("scpKeyVersion", keyVersion);
+ settings.setValue("scpSecurityLevel", levelIndex);
+ ui.statusBar->clearMessage();
+ if (!cardIface->isConnected())
+ {
+  ui.statusBar->showMessage("Card is not connected.");
+  return;
+ }
+ QString err;
+ try
+ {
+  if (scpSession->open([this](const Smartcards::APDUCommand& command) { return transmit(command); }, encKey, macKey, keyVersion, levelValues[levelIndex], err))
+   ui.statusBar->showMessage("SCP03 session is open.");
+  else
+   ui.statusBar->showMessage(err);
+ }
+ catch (SCardException& e)
+ {
+  ui.statusBar->showMessage(e.errorString());
+ }
+}
+
+void APDUUtility::closeSecureChannel()
+{
+ scpSession->close();
+ ui.statusBar->showMessage("SCP03 session is closed.");
+}
+
+Smartcards::APDUResponse APDUUtility::transmit(const Smartcards::APDUCommand& command)
+{
+ QElapsedTimer elapsed;
+ elapsed.start();
+ try
+ {
+  Smartcards::APDUResponse resp = cardIface->Transmit(command);
+  if (readerMetrics != nullptr)
+   readerMetrics->transmitted(resp.getSW1(), elapsed.nsecsElapsed() / 1000);
+  return resp;
+ }
+ catch (SCardException&)
+ {
+  if (readerMetrics != nullptr)
+   readerMetrics->transmitFailed(elapsed.nsecsElapsed() / 1000, isCardLost());
+  throw;
+ }
+}
+
+bool APDUUtility::isCardLost()
+{
+ //Malformed APDU fails transmit too, but card handle stays usable
+ DWORD state, protocol;
+ try
+ {
+  cardIface->GetCardStatus(state, protocol);
+ }
+ catch (SCardException&)
+ {
+  //Removed or reset card, no smart card or unavailable reader
+  return true;
+ }
+ return state < SCARD_POWERED;
+}
+
+void APDUUtility::stopTraceImport()
+{
+ if (importThread == nullptr)
+  return;
+ importThread->requestInterruption();
+ importThread->quit();
+ importThread->wait();
+ delete importThread;
+ importThread = nullptr;
+ delete importProgress;
+ importProgress = nullptr;
+}
+
 void APDUUtility::loadVendorCommandsList(const QString& filePath)
 {
  QFile loadFile(filePath);
@@ -319,7 +549,13 @@ void APDUUtility::loadVendorCommandsList(const QString& filePath)
  }
  APDUCommandsListModel->clear();
  QByteArray fileData = loadFile.readAll();
- QJsonDocument loadDoc(QJsonDocument::fromJson(fileData));
+ QJsonParseError parseError;
+ QJsonDocument loadDoc(QJsonDocument::fromJson(fileData, &parseError));
+ if (parseError.error != QJsonParseError::NoError)
+ {
+  ui.statusBar->showMessage("Couldn't parse vendor commands list file.\n" + parseError.errorString());
+  return;
+ }
  QJsonObject docObject = loadDoc.object();
  QStringList APDUCommandsNames = docObject.keys();
  for(auto APDUObjectIterator=docObject.constBegin();APDUObjectIterator!=docObject.constEnd();APDUObjectIterator++)
@@ -5,8 +5,12 @@
 
 #include <QtWidgets/QMainWindow>
 #include <QStandardItemModel>
+#include <QProgressDialog>
+#include <QThread>
 #include "ui_apduutility.h"
 #include "nativescard.h"
+#include "apdumetrics.h"
+#include "scp03.h"
 
 //! \class APDUUtility
 //! \brief APDU Utility main window class.
@@ -27,7 +31,7 @@ public:
 protected:
  //! \fn APDUUtility::timerEvent( QTimerEvent* event )
  //! \brief Qt timer event function
- //! \details Contains enabled operations for buttons
+ //! \details Contains enabled operations for buttons. Rewrites metrics file on metrics timer.
  //! \param[in] event pointer to Qt timer event class, ignored.
  void timerEvent(QTimerEvent *event);
  //! \fn APDUUtility::closeEvent(QCloseEvent *event)
@@ -77,6 +81,27 @@ private slots:
  //! \brief Provides change selected APDU command. Fill APDU command fields.
  //! \param[in] index index of selected APDU command in model.
  void APDUCommandsListViewActivated(const QModelIndex &index);
+ //! \fn void APDUUtility::importTrace(void)
+ //! \brief Import commands from pcscd or CCID trace log into new vendor in background thread.
+ void importTrace(void);
+ //! \fn void APDUUtility::traceImportFinished(int commandsCount, int duplicatesCount)
+ //! \brief Provides trace import completion. Select imported vendor.
+ //! \param[in] commandsCount count of imported commands.
+ //! \param[in] duplicatesCount count of skipped duplicate commands.
+ void traceImportFinished(int commandsCount, int duplicatesCount);
+ //! \fn void APDUUtility::traceImportFailed(const QString& err)
+ //! \brief Provides trace import failure.
+ //! \param[in] err error string.
+ void traceImportFailed(const QString& err);
+ //! \fn void APDUUtility::traceImportCanceled(void)
+ //! \brief Request interruption of trace import.
+ void traceImportCanceled(void);
+ //! \fn void APDUUtility::openSecureChannel(void)
+ //! \brief Ask static keys, key version and security level. Open SCP03 session with connected card.
+ void openSecureChannel(void);
+ //! \fn void APDUUtility::closeSecureChannel(void)
+ //! \brief Close SCP03 session. Following commands are transmitted without protection.
+ void closeSecureChannel(void);
 private:
  //! \fn void APDUUtility::loadVendorCommandsList(const QString& filePath)
  //! \brief Load vendor commands list from json-file.
@@ -99,10 +124,31 @@ private:
  //! \param[in] edit line edit where cursor is moved.
  //! \param[in] direction the direction of movement of the cursor.
  QLineEdit * move(QLineEdit *edit, MOVE direction);
+ //! \fn Smartcards::APDUResponse APDUUtility::transmit(const Smartcards::APDUCommand& command)
+ //! \brief Transmit APDU command to connected card and update reader metrics.
+ //! \details SCardException of transmit is rethrown.
+ //! \param[in] command APDU command.
+ Smartcards::APDUResponse transmit(const Smartcards::APDUCommand& command);
+ //! \fn bool APDUUtility::isCardLost(void)
+ //! \brief Checks state of connected card after failed transmit.
+ //! \return true if card was removed, reset or unpowered, or reader is unavailable.
+ bool isCardLost(void);
+ //! \fn void APDUUtility::stopTraceImport(void)
+ //! \brief Stop trace import thread and release it.
+ void stopTraceImport(void);
  Ui::APDUUtilityClass ui;//!< Qt inner ui-class
  QScopedPointer<Smartcards::WinSCard> cardIface{new Smartcards::WinSCard};//!< Scoped pointer to Smart Card Interface
  QScopedPointer<QStandardItemModel> APDUCommandsListModel{new QStandardItemModel};//! Scoped pointer to QStandardItemModel for APDU commands list
+ QScopedPointer<GlobalPlatform::SCP03Session> scpSession{new GlobalPlatform::SCP03Session};//!< Scoped pointer to SCP03 session with connected card
+ QScopedPointer<Metrics::MetricsRegistry> metrics{new Metrics::MetricsRegistry};//!< Scoped pointer to readers metrics registry
+ Metrics::ReaderMetrics *readerMetrics{ nullptr };//!< Metrics of connected reader, nullptr if not connected
+ QString metricsFilePath;//!< Path to Prometheus textfile with metrics. Reading from settings, empty disables export.
+ QThread *importThread{ nullptr };//!< Trace import thread, nullptr if import is not running
+ QProgressDialog *importProgress{ nullptr };//!< Trace import progress dialog
+ QString importVendor;//!< Vendor name for imported commands
  int tId{ 0 };//!< Qt timer identificator
+ int metricsTId{ 0 };//!< Qt timer identificator for metrics export
+ bool metricsWriteFailed{ false };//!< Last metrics file write failed flag
  int lastVendorIndex{ -1 };//!< index of last selected vendor in combo box
  Smartcards::SCOPE defaultScope{ Smartcards::User };//!< Default scope for EstablishContext. Reading from settings.
  Smartcards::SHARE defaultShare{ Smartcards::Shared };//!< Default share mode for Connect. Reading from settings.
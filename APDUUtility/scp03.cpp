@@ -0,0 +1,246 @@
+//! \file scp03.cpp
+//! \brief Source of GlobalPlatform SCP03 secure channel session class.
+#include <cstring>
+#include <random>
+
+#include "scp03.h"
+
+namespace
+{
+ const int CHALLENGE_SIZE = 8;//!< Host and card challenge size in S8 mode
+ const int MAC_SIZE = 8;//!< C-MAC and R-MAC size in S8 mode
+ const int INITIALIZE_UPDATE_RESPONSE_SIZE = 29;//!< Minimal INITIALIZE UPDATE response size
+ const quint8 CARD_CRYPTOGRAM = 0x00;//!< Derivation constant of card cryptogram
+ const quint8 HOST_CRYPTOGRAM = 0x01;//!< Derivation constant of host cryptogram
+ const quint8 S_ENC = 0x04;//!< Derivation constant of S-ENC
+ const quint8 S_MAC = 0x06;//!< Derivation constant of S-MAC
+ const quint8 S_RMAC = 0x07;//!< Derivation constant of S-RMAC
+
+ //! \fn QString statusWord(BYTE sw1, BYTE sw2)
+ //! \brief Returns status word as hex string.
+ QString statusWord(BYTE sw1, BYTE sw2)
+ {
+  return QString("%1%2").arg(sw1, 2, 16, QChar('0')).arg(sw2, 2, 16, QChar('0')).toUpper();
+ }
+}
+
+bool GlobalPlatform::SCP03Session::open(const Transmitter& transmit, const QByteArray& encKey, const QByteArray& macKey, BYTE keyVersion, BYTE securityLevel, QString& err)
+{
+ close();
+ if (!(securityLevel & C_MAC) || (securityLevel & ~(C_MAC | C_DECRYPTION | R_MAC | R_ENCRYPTION))
+  || ((securityLevel & R_ENCRYPTION) && !(securityLevel & R_MAC)))
+ {
+  err = "Unsupported security level.";
+  return false;
+ }
+ Crypto::CMAC staticEnc, staticMac;
+ if (encKey.size() != macKey.size() || !staticEnc.setKey(encKey) || !staticMac.setKey(macKey))
+ {
+  err = "Static keys must be AES keys of the same size.";
+  return false;
+ }
+ QByteArray hostChallenge(CHALLENGE_SIZE, 0);
+ std::random_device random;
+ for (char& c : hostChallenge)
+  c = static_cast<char>(random());
+ Smartcards::APDUResponse resp = transmit(Smartcards::APDUCommand(0x80, 0x50, keyVersion, 0x00, hostChallenge, 0x00));
+ if (resp.getSW1() != 0x90 || resp.getSW2() != 0x00)
+ {
+  err = "INITIALIZE UPDATE failed, SW " + statusWord(resp.getSW1(), resp.getSW2()) + ".";
+  return false;
+ }
+ QByteArray data = resp.getData();
+ //Key diversification data (10), key information (3), card challenge (8), card cryptogram (8), sequence counter (3, optional)
+ if (data.size() < INITIALIZE_UPDATE_RESPONSE_SIZE || data.at(11) != 0x03)
+ {
+  err = "Card doesn't support SCP03.";
+  return false;
+ }
+ if (data.at(12) & 0x01)
+ {
+  err = "SCP03 S16 mode is not supported.";
+  return false;
+ }
+ std::memcpy(context, hostChallenge.constData(), CHALLENGE_SIZE);
+ std::memcpy(context + CHALLENGE_SIZE, data.constData() + 13, CHALLENGE_SIZE);
+ //Session keys are derived once and kept as expanded key schedules for the whole session
+ quint8 key[32];
+ int keyBits = encKey.size() * 8;
+ derive(staticEnc, S_ENC, keyBits, key);
+ sEnc.setKey(QByteArray(reinterpret_cast<const char*>(key), encKey.size()));
+ derive(staticMac, S_MAC, keyBits, key);
+ sMac.setKey(QByteArray(reinterpret_cast<const char*>(key), encKey.size()));
+ derive(staticMac, S_RMAC, keyBits, key);
+ sRmac.setKey(QByteArray(reinterpret_cast<const char*>(key), encKey.size()));
+ std::memset(key, 0, sizeof(key));
+ quint8 cryptogram[Crypto::AES_BLOCK_SIZE];
+ derive(sMac, CARD_CRYPTOGRAM, 64, cryptogram);
+ if (std::memcmp(cryptogram, data.constData() + 21, 8) != 0)
+ {
+  close();
+  err = "Card cryptogram verification failed.";
+  return false;
+ }
+ derive(sMac, HOST_CRYPTOGRAM, 64, cryptogram);
+ //EXTERNAL AUTHENTICATE is protected by C-MAC only, chaining starts from zero
+ buffer.reserve(256);
+ level = C_MAC;
+ opened = true;
+ Smartcards::APDUCommand extAuth;
+ wrap(Smartcards::APDUCommand(0x80, 0x82, securityLevel, 0x00, QByteArray(reinterpret_cast<const char*>(cryptogram), 8), 0x00), extAuth, err);
+ try
+ {
+  resp = transmit(extAuth);
+ }
+ catch (...)
+ {
+  close();
+  throw;
+ }
+ if (resp.getSW1() != 0x90 || resp.getSW2() != 0x00)
+ {
+  close();
+  err = "EXTERNAL AUTHENTICATE failed, SW " + statusWord(resp.getSW1(), resp.getSW2()) + ".";
+  return false;
+ }
+ level = securityLevel;
+ encCounter = 1;
+ return true;
+}
+
+void GlobalPlatform::SCP03Session::close()
+{
+ sEnc = Crypto::AES();
+ sMac = Crypto::CMAC();
+ sRmac = Crypto::CMAC();
+ std::memset(context, 0, sizeof(context));
+ std::memset(macChaining, 0, sizeof(macChaining));
+ encCounter = 0;
+ responseCounter = 0;
+ level = 0;
+ opened = false;
+}
+
+bool GlobalPlatform::SCP03Session::wrap(const Smartcards::APDUCommand& command, Smartcards::APDUCommand& wrapped, QString& err)
+{
+ if (!opened)
+ {
+  err = "Secure channel is not open.";
+  return false;
+ }
+ buffer.resize(0);
+ buffer.append(command.getData());
+ bool encrypt = (level & C_DECRYPTION) && !buffer.isEmpty();
+ int paddedSize = encrypt ? (buffer.size() / Crypto::AES_BLOCK_SIZE + 1) * Crypto::AES_BLOCK_SIZE : buffer.size();
+ if (paddedSize + MAC_SIZE > 255)
+ {
+  err = "Command data is too long for secure messaging.";
+  return false;
+ }
+ //Encryption counter is incremented for each command, even without data
+ responseCounter = encCounter++;
+ if (encrypt)
+ {
+  quint8 icv[Crypto::AES_BLOCK_SIZE];
+  counterBlock(0x00, responseCounter, icv);
+  buffer.append(static_cast<char>(0x80));
+  buffer.append(paddedSize - buffer.size(), 0);
+  sEnc.encryptCBC(icv, reinterpret_cast<quint8*>(buffer.data()), buffer.size());
+ }
+ //Further interindustry class bytes indicate secure messaging with bit 6, others with bit 3
+ BYTE CLA = command.getClass();
+ CLA |= (CLA & 0x40) ? 0x20 : 0x04;
+ const quint8 header[5] = { CLA, command.getIns(), command.getP1(), command.getP2(), static_cast<quint8>(buffer.size() + MAC_SIZE) };
+ sMac.update(macChaining, Crypto::AES_BLOCK_SIZE);
+ sMac.update(header, 5);
+ sMac.update(buffer);
+ sMac.final(macChaining);
+ buffer.append(reinterpret_cast<const char*>(macChaining), MAC_SIZE);
+ //Deep copy keeps buffer capacity for the next command
+ wrapped = Smartcards::APDUCommand(CLA, command.getIns(), command.getP1(), command.getP2(), QByteArray(buffer.constData(), buffer.size()), command.getLe());
+ return true;
+}
+
+bool GlobalPlatform::SCP03Session::unwrap(BYTE sw1, BYTE sw2, QByteArray& data, QString& err)
+{
+ if (!opened)
+  return true;
+ //Only 9000 and warnings 62xx, 63xx are protected
+ if (!((sw1 == 0x90 && sw2 == 0x00) || sw1 == 0x62 || sw1 == 0x63))
+  return true;
+ if (level & R_MAC)
+ {
+  if (data.size() < MAC_SIZE)
+  {
+   err = "Response is too short for R-MAC.";
+   return false;
+  }
+  int size = data.size() - MAC_SIZE;
+  const quint8 sw[2] = { sw1, sw2 };
+  quint8 mac[Crypto::AES_BLOCK_SIZE];
+  sRmac.update(macChaining, Crypto::AES_BLOCK_SIZE);
+  sRmac.update(reinterpret_cast<const quint8*>(data.constData()), size);
+  sRmac.update(sw, 2);
+  sRmac.final(mac);
+  quint8 diff = 0;
+  for (int i = 0; i < MAC_SIZE; ++i)
+   diff |= mac[i] ^ static_cast<quint8>(data.at(size + i));
+  if (diff != 0)
+  {
+   err = "R-MAC verification failed.";
+   return false;
+  }
+  data.truncate(size);
+ }
+ if ((level & R_ENCRYPTION) && !data.isEmpty())
+ {
+  if (data.size() % Crypto::AES_BLOCK_SIZE != 0)
+  {
+   err = "Encrypted response data length is not multiple of block size.";
+   return false;
+  }
+  quint8 icv[Crypto::AES_BLOCK_SIZE];
+  counterBlock(0x80, responseCounter, icv);
+  sEnc.decryptCBC(icv, reinterpret_cast<quint8*>(data.data()), data.size());
+  int padding = data.size() - 1;
+  while (padding >= data.size() - Crypto::AES_BLOCK_SIZE && data.at(padding) == 0)
+   --padding;
+  if (padding < data.size() - Crypto::AES_BLOCK_SIZE || static_cast<quint8>(data.at(padding)) != 0x80)
+  {
+   err = "Invalid response data padding.";
+   return false;
+  }
+  data.truncate(padding);
+ }
+ return true;
+}
+
+void GlobalPlatform::SCP03Session::derive(Crypto::CMAC& prf, quint8 constant, int lengthBits, quint8* out)
+{
+ //Label (11 zero bytes and constant), separation indicator, L, i, context
+ quint8 derivationData[16] = {};
+ derivationData[11] = constant;
+ derivationData[13] = static_cast<quint8>(lengthBits >> 8);
+ derivationData[14] = static_cast<quint8>(lengthBits);
+ int length = lengthBits / 8;
+ quint8 block[Crypto::AES_BLOCK_SIZE];
+ for (int i = 1, offset = 0; offset < length; ++i, offset += Crypto::AES_BLOCK_SIZE)
+ {
+  derivationData[15] = static_cast<quint8>(i);
+  prf.update(derivationData, sizeof(derivationData));
+  prf.update(context, sizeof(context));
+  prf.final(block);
+  std::memcpy(out + offset, block, qMin(Crypto::AES_BLOCK_SIZE, length - offset));
+ }
+}
+
+void GlobalPlatform::SCP03Session::counterBlock(quint8 prefix, quint32 counter, quint8* icv) const
+{
+ std::memset(icv, 0, Crypto::AES_BLOCK_SIZE);
+ icv[0] = prefix;
+ icv[12] = static_cast<quint8>(counter >> 24);
+ icv[13] = static_cast<quint8>(counter >> 16);
+ icv[14] = static_cast<quint8>(counter >> 8);
+ icv[15] = static_cast<quint8>(counter);
+ sEnc.encryptBlock(icv, icv);
+}
@@ -0,0 +1,91 @@
+//! \file scp03.h
+//! \brief Header file for GlobalPlatform SCP03 secure channel session class.
+#ifndef SCP03_H
+#define SCP03_H
+
+#include <functional>
+#include <QByteArray>
+#include <QString>
+#include "nativescard.h"
+#include "aes.h"
+
+namespace GlobalPlatform
+{
+ //! \enum SECURITY_LEVEL
+ //! \brief Security level bits of EXTERNAL AUTHENTICATE P1.
+ enum SECURITY_LEVEL
+ {
+  C_MAC = 0x01,        //!< Command MAC
+  C_DECRYPTION = 0x02, //!< Command data encryption
+  R_MAC = 0x10,        //!< Response MAC
+  R_ENCRYPTION = 0x20  //!< Response data encryption
+ };
+
+ //! \brief Transmits APDU command to card. Used by session for its own commands, so they pass the same transmit path as user commands.
+ typedef std::function<Smartcards::APDUResponse(const Smartcards::APDUCommand&)> Transmitter;
+
+ //! \class SCP03Session
+ //! \brief GlobalPlatform SCP03 (Card Specification Amendment D) secure channel session.
+ //! \details Session keys are derived once in open() and kept as expanded AES and CMAC key schedules until close(),
+ //! so wrap() and unwrap() of each APDU only run block operations. Only S8 mode and short APDUs are supported.
+ class SCP03Session
+ {
+ public:
+  //! \fn bool SCP03Session::open(const Transmitter& transmit, const QByteArray& encKey, const QByteArray& macKey, BYTE keyVersion, BYTE securityLevel, QString& err)
+  //! \brief Opens secure channel: sends INITIALIZE UPDATE and EXTERNAL AUTHENTICATE to connected card.
+  //! \details SCardException of transmit is not caught.
+  //! \param[in] transmit transmit function of connected card.
+  //! \param[in] encKey static ENC key, 16, 24 or 32 bytes.
+  //! \param[in] macKey static MAC key, same size as ENC key.
+  //! \param[in] keyVersion key version number, 0 for default keys.
+  //! \param[in] securityLevel combination of SECURITY_LEVEL bits.
+  //! \param[out] err error string, if open failed.
+  //! \return true on success.
+  bool open(const Transmitter& transmit, const QByteArray& encKey, const QByteArray& macKey, BYTE keyVersion, BYTE securityLevel, QString& err);
+  //! \fn void SCP03Session::close(void)
+  //! \brief Closes session and forgets session keys.
+  void close(void);
+  //! \fn bool SCP03Session::isOpen(void) const
+  //! \brief Returns true if session is open.
+  bool isOpen(void) const { return opened; }
+  //! \fn bool SCP03Session::wrap(const Smartcards::APDUCommand& command, Smartcards::APDUCommand& wrapped, QString& err)
+  //! \brief Applies C-DECRYPTION and C-MAC to command according to session security level.
+  //! \param[in] command plain command.
+  //! \param[out] wrapped protected command.
+  //! \param[out] err error string, if command can't be wrapped.
+  //! \return true on success.
+  bool wrap(const Smartcards::APDUCommand& command, Smartcards::APDUCommand& wrapped, QString& err);
+  //! \fn bool SCP03Session::unwrap(BYTE sw1, BYTE sw2, QByteArray& data, QString& err)
+  //! \brief Verifies R-MAC and decrypts response data of the last wrapped command.
+  //! \details Responses with error status word carry no protection and are left unchanged.
+  //! \param[in] sw1 first byte of status word.
+  //! \param[in] sw2 second byte of status word.
+  //! \param[in,out] data response data, replaced with plain data.
+  //! \param[out] err error string, if verification failed.
+  //! \return true on success.
+  bool unwrap(BYTE sw1, BYTE sw2, QByteArray& data, QString& err);
+ private:
+  //! \fn void SCP03Session::derive(Crypto::CMAC& prf, quint8 constant, int lengthBits, quint8 *out)
+  //! \brief NIST SP 800-108 KDF in counter mode with CMAC as PRF.
+  //! \param[in] prf CMAC with base key.
+  //! \param[in] constant derivation constant.
+  //! \param[in] lengthBits length of derived data in bits.
+  //! \param[out] out derived data.
+  void derive(Crypto::CMAC& prf, quint8 constant, int lengthBits, quint8 *out);
+  //! \fn void SCP03Session::counterBlock(quint8 prefix, quint32 counter, quint8 *icv) const
+  //! \brief Computes ICV for command or response encryption.
+  void counterBlock(quint8 prefix, quint32 counter, quint8 *icv) const;
+  Crypto::AES sEnc;//!< Session encryption key schedule
+  Crypto::CMAC sMac;//!< Session C-MAC key schedule
+  Crypto::CMAC sRmac;//!< Session R-MAC key schedule
+  quint8 context[16]{};//!< KDF context: host challenge and card challenge
+  quint8 macChaining[Crypto::AES_BLOCK_SIZE]{};//!< MAC chaining value
+  quint32 encCounter{ 0 };//!< Encryption counter of next command
+  quint32 responseCounter{ 0 };//!< Encryption counter of last wrapped command
+  QByteArray buffer;//!< Reusable buffer for command data
+  BYTE level{ 0 };//!< Security level of open session
+  bool opened{ false };//!< Session is open flag
+ };
+}
+
+#endif // SCP03_H
@@ -36,6 +36,8 @@ settingsWidget::settingsWidget(QWidget* parent)
  int scope = settings.value("scope", 0).toInt();
  int shareMode = settings.value("shareMode", 0).toInt();
  int protocol = settings.value("protocol", 0).toInt();
+ QString metricsFile = settings.value("metricsFile", "").toString();
+ int metricsInterval = settings.value("metricsInterval", 15).toInt();
  int index = ui.defaultReaderComboBox->findText(readerName,Qt::MatchContains);
  if (index > 0)
  {
@@ -48,6 +50,8 @@ settingsWidget::settingsWidget(QWidget* parent)
  ui.scopeComboBox->setCurrentIndex(scope);
  ui.shareModeComboBox->setCurrentIndex(shareMode);
  ui.protocolComboBox->setCurrentIndex(protocol);
+ ui.metricsFileLineEdit->setText(metricsFile);
+ ui.metricsIntervalSpinBox->setValue(metricsInterval);
  connect(ui.reloadReadersButton, SIGNAL(clicked()), this, SLOT(reloadButtonClicked()));
  connect(ui.closeButton, SIGNAL(clicked()), this, SLOT(closeButtonClicked()));
  connect(ui.defaultReaderComboBox, SIGNAL(currentTextChanged(const QString&)), this, SLOT(defaultReaderComboBoxTextChanged(const QString&)));
@@ -90,6 +94,8 @@ void settingsWidget::closeButtonClicked()
  settings.setValue("scope", ui.scopeComboBox->currentIndex());
  settings.setValue("shareMode", ui.shareModeComboBox->currentIndex());
  settings.setValue("protocol", ui.protocolComboBox->currentIndex());
+ settings.setValue("metricsFile", ui.metricsFileLineEdit->text());
+ settings.setValue("metricsInterval", ui.metricsIntervalSpinBox->value());
  close();
 }
 
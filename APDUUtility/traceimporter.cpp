@@ -0,0 +1,514 @@
+//! \file traceimporter.cpp
+//! \brief Source of PC/SC, CCID trace logs and USB captures importer class.
+#include <algorithm>
+#include <cstring>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+#include <QVector>
+#include <QtEndian>
+
+#include "traceimporter.h"
+
+namespace
+{
+ const qint64 mapWindowSize = 64 * 1024 * 1024;//!< Size of memory mapped window of trace file
+ const int maxLineLength = 1024 * 1024;//!< Longer lines are skipped, so line buffer stays bounded
+ const qint64 progressStep = 1024 * 1024;//!< Progress is reported and interruption is checked after each parsed step
+ const char pcscdCommandMarker[] = "APDU: ";//!< pcscd command line marker
+ const char pcscdResponseMarker[] = "SW: ";//!< pcscd response line marker
+ const char ccidCommandMarker[] = "-> ";//!< libccid sent USB frame line marker
+ const char ccidResponseMarker[] = "<- ";//!< libccid received USB frame line marker
+ const int ccidHeaderSize = 10;//!< CCID message header size
+ const char ccidXfrBlock = 0x6F;//!< PC_to_RDR_XfrBlock message type
+ const char ccidDataBlock = static_cast<char>(0x80);//!< RDR_to_PC_DataBlock message type
+ const quint32 maxPacketSize = 16 * 1024 * 1024;//!< Larger capture records are treated as corrupted or skipped
+ const QByteArray pcapMagicLE("\xD4\xC3\xB2\xA1", 4);//!< pcap magic of little endian file with microsecond timestamps
+ const QByteArray pcapNanoMagicLE("\x4D\x3C\xB2\xA1", 4);//!< pcap magic of little endian file with nanosecond timestamps
+ const QByteArray pcapMagicBE("\xA1\xB2\xC3\xD4", 4);//!< pcap magic of big endian file with microsecond timestamps
+ const QByteArray pcapNanoMagicBE("\xA1\xB2\x3C\x4D", 4);//!< pcap magic of big endian file with nanosecond timestamps
+ const QByteArray pcapngMagic("\x0A\x0D\x0D\x0A", 4);//!< pcapng section header block type
+ const QByteArray pcapngByteOrderLE("\x4D\x3C\x2B\x1A", 4);//!< pcapng byte order magic of little endian section
+ const QByteArray pcapngByteOrderBE("\x1A\x2B\x3C\x4D", 4);//!< pcapng byte order magic of big endian section
+ const int pcapHeaderSize = 24;//!< pcap file header size
+ const int pcapRecordHeaderSize = 16;//!< pcap record header size
+ const int pcapngBlockHeaderSize = 8;//!< pcapng block type and length size
+ const quint32 pcapngSectionHeaderBlock = 0x0A0D0D0A;//!< pcapng section header block type
+ const quint32 pcapngInterfaceBlock = 1;//!< pcapng interface description block type
+ const quint32 pcapngSimplePacketBlock = 3;//!< pcapng simple packet block type
+ const quint32 pcapngEnhancedPacketBlock = 6;//!< pcapng enhanced packet block type
+ const quint32 linkTypeUsbLinux = 189;//!< LINKTYPE_USB_LINUX, usbmon with 48 bytes header
+ const quint32 linkTypeUsbPcap = 249;//!< LINKTYPE_USBPCAP, USBPcap on Windows
+ const quint32 linkTypeUsbLinuxMmapped = 220;//!< LINKTYPE_USB_LINUX_MMAPPED, usbmon with 64 bytes header
+ const int usbPcapHeaderSize = 27;//!< USBPcap header size of bulk transfer
+ const int usbmonHeaderSize = 48;//!< usbmon header size
+ const int usbmonMmappedHeaderSize = 64;//!< Memory mapped usbmon header size
+ const char usbTransferBulk = 3;//!< Bulk transfer type of USBPcap and usbmon headers
+
+ //! \fn const char* findMarker(const char *begin, const char *end, const char (&marker)[N])
+ //! \brief Returns pointer after marker in line or nullptr, if marker not found.
+ template<size_t N>
+ const char* findMarker(const char *begin, const char *end, const char (&marker)[N])
+ {
+  const char *found = std::search(begin, end, marker, marker + N - 1);
+  return found == end ? nullptr : found + N - 1;
+ }
+
+ //! \fn int hexDigit(char c)
+ //! \brief Returns value of hex digit or -1.
+ int hexDigit(char c)
+ {
+  if (c >= '0' && c <= '9')
+   return c - '0';
+  if (c >= 'a' && c <= 'f')
+   return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+   return c - 'A' + 10;
+  return -1;
+ }
+
+ //! \fn quint32 readUInt32(const char *data, bool bigEndian)
+ //! \brief Returns 32-bit unsigned integer of capture in given byte order.
+ quint32 readUInt32(const char *data, bool bigEndian)
+ {
+  const uchar *bytes = reinterpret_cast<const uchar*>(data);
+  return bigEndian ? qFromBigEndian<quint32>(bytes) : qFromLittleEndian<quint32>(bytes);
+ }
+
+ //! \fn quint16 readUInt16(const char *data, bool bigEndian)
+ //! \brief Returns 16-bit unsigned integer of capture in given byte order.
+ quint16 readUInt16(const char *data, bool bigEndian)
+ {
+  const uchar *bytes = reinterpret_cast<const uchar*>(data);
+  return bigEndian ? qFromBigEndian<quint16>(bytes) : qFromLittleEndian<quint16>(bytes);
+ }
+
+ //! \fn quint64 commandHash(const QByteArray& command)
+ //! \brief Returns 64-bit FNV-1a hash of command bytes.
+ quint64 commandHash(const QByteArray& command)
+ {
+  quint64 hash = 14695981039346656037ULL;
+  for (char c : command)
+  {
+   hash ^= static_cast<quint8>(c);
+   hash *= 1099511628211ULL;
+  }
+  return hash;
+ }
+}
+
+TraceImporter::TraceImporter(const QString& traceFilePath, const QString& vendorFilePath, QObject* parent)
+ : QObject(parent), traceFilePath(traceFilePath), vendorFile(vendorFilePath, this)
+{
+ command.reserve(512);
+ response.reserve(512);
+}
+
+void TraceImporter::run()
+{
+ QFile traceFile(traceFilePath);
+ if (!traceFile.open(QIODevice::ReadOnly))
+ {
+  emit failed("Couldn't open trace file for read.\n" + traceFile.errorString());
+  return;
+ }
+ if (!vendorFile.open(QIODevice::WriteOnly))
+ {
+  emit failed("Couldn't open vendor commands list file for save.\n" + vendorFile.errorString());
+  return;
+ }
+ vendorFile.write("{");
+ QByteArray magic = traceFile.peek(4);
+ bool parsed;
+ if (magic == pcapngMagic)
+  parsed = parsePcapng(traceFile);
+ else if (magic == pcapMagicLE || magic == pcapNanoMagicLE || magic == pcapMagicBE || magic == pcapNanoMagicBE)
+  parsed = parsePcap(traceFile);
+ else
+  parsed = parseText(traceFile);
+ if (!parsed)
+  return;
+ reportProgress(traceFile.size(), traceFile.size());
+ //Uncommitted vendor file is discarded
+ if (commandsCount == 0)
+ {
+  emit failed("No APDU commands found in trace file.");
+  return;
+ }
+ vendorFile.write("\n}\n");
+ if (!vendorFile.commit())
+ {
+  emit failed("Couldn't write vendor commands list file.\n" + vendorFile.errorString());
+  return;
+ }
+ emit finished(commandsCount, duplicatesCount);
+}
+
+bool TraceImporter::parseText(QFile& traceFile)
+{
+ qint64 size = traceFile.size();
+ QByteArray readBuffer;
+ bool lineTooLong = false;
+ for (qint64 offset = 0; offset < size; offset += mapWindowSize)
+ {
+  qint64 length = qMin(mapWindowSize, size - offset);
+  uchar *window = traceFile.map(offset, length);
+  const char *data = reinterpret_cast<const char*>(window);
+  if (window == nullptr)
+  {
+   //Fall back to buffered read, if file can't be mapped
+   traceFile.seek(offset);
+   readBuffer = traceFile.read(length);
+   if (readBuffer.size() != length)
+   {
+    emit failed("Couldn't read trace file.\n" + traceFile.errorString());
+    return false;
+   }
+   data = readBuffer.constData();
+  }
+  const char *lineBegin = data;
+  const char *windowEnd = data + length;
+  const char *nextProgress = data;
+  while (const char *lineEnd = static_cast<const char*>(std::memchr(lineBegin, '\n', windowEnd - lineBegin)))
+  {
+   if (lineTooLong)
+    lineTooLong = false;
+   else if (!lineBuffer.isEmpty())
+   {
+    lineBuffer.append(lineBegin, static_cast<int>(lineEnd - lineBegin));
+    parseLine(lineBuffer.constData(), lineBuffer.constData() + lineBuffer.size());
+   }
+   else
+    parseLine(lineBegin, lineEnd);
+   lineBuffer.resize(0);
+   lineBegin = lineEnd + 1;
+   if (lineBegin >= nextProgress)
+   {
+    if (!reportProgress(offset + (lineBegin - data), size))
+    {
+     emit failed("Trace import interrupted.");
+     return false;
+    }
+    nextProgress = lineBegin + progressStep;
+   }
+  }
+  //Keep tail of window for next window
+  if (!lineTooLong)
+  {
+   if (lineBuffer.size() + (windowEnd - lineBegin) > maxLineLength)
+   {
+    lineBuffer.resize(0);
+    lineTooLong = true;
+   }
+   else
+    lineBuffer.append(lineBegin, static_cast<int>(windowEnd - lineBegin));
+  }
+  if (window != nullptr)
+   traceFile.unmap(window);
+ }
+ if (!lineTooLong && !lineBuffer.isEmpty())
+  parseLine(lineBuffer.constData(), lineBuffer.constData() + lineBuffer.size());
+ return true;
+}
+
+bool TraceImporter::parsePcap(QFile& traceFile)
+{
+ //Magic, version (4), time zone (4), sigfigs (4), snapshot length (4), link type (4)
+ QByteArray header = traceFile.read(pcapHeaderSize);
+ if (header.size() != pcapHeaderSize)
+ {
+  emit failed("Couldn't read capture header.\n" + traceFile.errorString());
+  return false;
+ }
+ bool bigEndian = header.startsWith(pcapMagicBE) || header.startsWith(pcapNanoMagicBE);
+ quint32 linkType = readUInt32(header.constData() + 20, bigEndian) & 0xFFFF;
+ qint64 size = traceFile.size();
+ qint64 nextProgress = 0;
+ //Timestamp (8), captured length (4), original length (4); truncated last record is ignored
+ while ((header = traceFile.read(pcapRecordHeaderSize)).size() == pcapRecordHeaderSize)
+ {
+  quint32 capturedLength = readUInt32(header.constData() + 8, bigEndian);
+  if (capturedLength > maxPacketSize)
+  {
+   emit failed("Capture file is corrupted.");
+   return false;
+  }
+  packet.resize(static_cast<int>(capturedLength));
+  if (traceFile.read(packet.data(), capturedLength) != static_cast<qint64>(capturedLength))
+   break;
+  parseUsbPacket(linkType, bigEndian, packet.constData(), packet.size());
+  if (traceFile.pos() >= nextProgress)
+  {
+   if (!reportProgress(traceFile.pos(), size))
+   {
+    emit failed("Trace import interrupted.");
+    return false;
+   }
+   nextProgress = traceFile.pos() + progressStep;
+  }
+ }
+ return true;
+}
+
+bool TraceImporter::parsePcapng(QFile& traceFile)
+{
+ QVector<quint32> linkTypes;
+ bool bigEndian = false;
+ qint64 size = traceFile.size();
+ qint64 nextProgress = 0;
+ QByteArray header;
+ //Block type (4), block total length (4), body, block total length (4); truncated last block is ignored
+ while ((header = traceFile.read(pcapngBlockHeaderSize)).size() == pcapngBlockHeaderSize)
+ {
+  quint32 blockType = readUInt32(header.constData(), bigEndian);
+  if (header.startsWith(pcapngMagic))
+  {
+   //Section header block: byte order magic follows block length and sets byte order of the section
+   QByteArray byteOrder = traceFile.peek(4);
+   if (byteOrder.size() != 4)
+    break;
+   bigEndian = byteOrder == pcapngByteOrderBE;
+   if (!bigEndian && byteOrder != pcapngByteOrderLE)
+   {
+    emit failed("Capture file is corrupted.");
+    return false;
+   }
+   blockType = pcapngSectionHeaderBlock;
+   linkTypes.clear();
+  }
+  quint32 blockLength = readUInt32(header.constData() + 4, bigEndian);
+  if (blockLength < pcapngBlockHeaderSize + 4 || blockLength % 4 != 0)
+  {
+   emit failed("Capture file is corrupted.");
+   return false;
+  }
+  quint32 bodyLength = blockLength - pcapngBlockHeaderSize;
+  if (bodyLength > maxPacketSize)
+  {
+   if (!traceFile.seek(traceFile.pos() + bodyLength))
+    break;
+   continue;
+  }
+  packet.resize(static_cast<int>(bodyLength));
+  if (traceFile.read(packet.data(), bodyLength) != static_cast<qint64>(bodyLength))
+   break;
+  const char *body = packet.constData();
+  if (blockType == pcapngInterfaceBlock && bodyLength >= 8)
+   linkTypes.append(readUInt16(body, bigEndian));
+  else if (blockType == pcapngEnhancedPacketBlock && bodyLength >= 24)
+  {
+   //Interface id (4), timestamp (8), captured length (4), original length (4), packet data
+   quint32 interfaceId = readUInt32(body, bigEndian);
+   quint32 capturedLength = qMin(readUInt32(body + 12, bigEndian), bodyLength - 24);
+   if (interfaceId < static_cast<quint32>(linkTypes.size()))
+    parseUsbPacket(linkTypes.at(interfaceId), bigEndian, body + 20, static_cast<int>(capturedLength));
+  }
+  else if (blockType == pcapngSimplePacketBlock && bodyLength >= 8 && !linkTypes.isEmpty())
+  {
+   //Original length (4), packet data of first interface
+   quint32 capturedLength = qMin(readUInt32(body, bigEndian), bodyLength - 8);
+   parseUsbPacket(linkTypes.first(), bigEndian, body + 4, static_cast<int>(capturedLength));
+  }
+  if (traceFile.pos() >= nextProgress)
+  {
+   if (!reportProgress(traceFile.pos(), size))
+   {
+    emit failed("Trace import interrupted.");
+    return false;
+   }
+   nextProgress = traceFile.pos() + progressStep;
+  }
+ }
+ return true;
+}
+
+void TraceImporter::parseUsbPacket(quint32 linkType, bool bigEndian, const char* data, int length)
+{
+ int headerLength;
+ bool sent;
+ quint32 dataLength;
+ if (linkType == linkTypeUsbPcap)
+ {
+  //USBPcap header is always little endian. Bulk OUT data is captured on submission, bulk IN data on completion
+  if (length < usbPcapHeaderSize || data[22] != usbTransferBulk)
+   return;
+  headerLength = readUInt16(data, false);
+  sent = !(data[21] & 0x80);
+  if (sent == ((data[16] & 0x01) != 0))
+   return;
+  dataLength = readUInt32(data + 23, false);
+ }
+ else if (linkType == linkTypeUsbLinux || linkType == linkTypeUsbLinuxMmapped)
+ {
+  //usbmon header: bulk OUT data is captured on submission ('S'), bulk IN data on completion ('C')
+  headerLength = linkType == linkTypeUsbLinux ? usbmonHeaderSize : usbmonMmappedHeaderSize;
+  if (length < headerLength || data[9] != usbTransferBulk)
+   return;
+  sent = !(data[10] & 0x80);
+  if (data[8] != (sent ? 'S' : 'C'))
+   return;
+  dataLength = readUInt32(data + 36, bigEndian);
+ }
+ else
+  return;
+ if (headerLength > length || dataLength > static_cast<quint32>(length - headerLength) || dataLength < static_cast<quint32>(ccidHeaderSize))
+  return;
+ //Other USB devices of capture are filtered out by exact CCID message length
+ const char *frame = data + headerLength;
+ if (readUInt32(frame + 1, false) != dataLength - ccidHeaderSize)
+  return;
+ response.resize(0);
+ response.append(frame, static_cast<int>(dataLength));
+ parseCcidFrame(sent);
+}
+
+bool TraceImporter::reportProgress(qint64 position, qint64 size)
+{
+ int percent = size > 0 ? static_cast<int>(position * 100 / size) : 100;
+ if (percent != lastPercent)
+ {
+  lastPercent = percent;
+  emit progress(percent);
+ }
+ return !QThread::currentThread()->isInterruptionRequested();
+}
+
+void TraceImporter::parseLine(const char* begin, const char* end)
+{
+ if (begin != end && *(end - 1) == '\r')
+  --end;
+ if (const char *hex = findMarker(begin, end, pcscdCommandMarker))
+ {
+  commandPending = parseHex(hex, end, command);
+  return;
+ }
+ if (const char *hex = findMarker(begin, end, pcscdResponseMarker))
+ {
+  if (commandPending && parseHex(hex, end, response))
+   addCommand(response);
+  commandPending = false;
+  return;
+ }
+ const char *hex = findMarker(begin, end, ccidCommandMarker);
+ bool sent = hex != nullptr;
+ if (!sent)
+  hex = findMarker(begin, end, ccidResponseMarker);
+ if (hex == nullptr)
+  return;
+ //Skip reader index, libccid logs "-> 000000 6F ..."
+ const char *offsetEnd = std::find(hex, end, ' ');
+ if (offsetEnd - hex != 2)
+  hex = offsetEnd;
+ if (parseHex(hex, end, response))
+  parseCcidFrame(sent);
+}
+
+void TraceImporter::parseCcidFrame(bool sent)
+{
+ if (response.size() < ccidHeaderSize)
+  return;
+ quint32 payloadLength = static_cast<quint8>(response.at(1)) | static_cast<quint8>(response.at(2)) << 8
+  | static_cast<quint8>(response.at(3)) << 16 | static_cast<quint32>(static_cast<quint8>(response.at(4))) << 24;
+ int payloadSize = static_cast<int>(qMin<quint32>(payloadLength, response.size() - ccidHeaderSize));
+ if (sent)
+ {
+  if (response.at(0) != ccidXfrBlock)
+   return;
+  //wLevelParameter is not zero for extended APDU chained in several frames, such commands are not imported
+  commandPending = response.at(8) == 0 && response.at(9) == 0;
+  if (commandPending)
+  {
+   command = response.mid(ccidHeaderSize, payloadSize);
+   commandSequence = response.at(6);
+  }
+ }
+ //Response is paired with command by bSeq
+ else if (response.at(0) == ccidDataBlock && commandPending && response.at(6) == commandSequence)
+ {
+  //bChainParameter is not zero for chained response
+  if (response.at(9) != 0)
+  {
+   commandPending = false;
+   return;
+  }
+  //bmCommandStatus: 0 - processed, 1 - failed, 2 - time extension requested
+  int commandStatus = (static_cast<quint8>(response.at(7)) >> 6) & 0x03;
+  if (commandStatus == 2)
+   return;
+  if (commandStatus == 0)
+  {
+   response = response.mid(ccidHeaderSize, payloadSize);
+   addCommand(response);
+  }
+  commandPending = false;
+ }
+}
+
+bool TraceImporter::parseHex(const char* begin, const char* end, QByteArray& bytes) const
+{
+ bytes.resize(0);
+ const char *c = begin;
+ while (c != end)
+ {
+  if (*c == ' ' || *c == '\t')
+  {
+   ++c;
+   continue;
+  }
+  if (end - c < 2)
+   return false;
+  int high = hexDigit(c[0]);
+  int low = hexDigit(c[1]);
+  if (high < 0 || low < 0 || (end - c > 2 && c[2] != ' ' && c[2] != '\t'))
+   return false;
+  bytes.append(static_cast<char>(high << 4 | low));
+  c += 2;
+ }
+ return !bytes.isEmpty();
+}
+
+void TraceImporter::addCommand(const QByteArray& responseBytes)
+{
+ int size = command.size();
+ if (size < 4)
+  return;
+ BYTE Le = 0;
+ QByteArray data;
+ if (size == 5)
+  Le = command.at(4);
+ else if (size > 5)
+ {
+  //Extended length commands can't be stored in vendor commands list
+  int Lc = static_cast<quint8>(command.at(4));
+  if (Lc == 0 || size < 5 + Lc || size > 6 + Lc)
+   return;
+  data = command.mid(5, Lc);
+  if (size == 6 + Lc)
+   Le = command.at(5 + Lc);
+ }
+ quint64 hash = commandHash(command);
+ if (commandHashes.contains(hash))
+ {
+  ++duplicatesCount;
+  return;
+ }
+ commandHashes.insert(hash);
+ Smartcards::APDUCommand apdu(command.at(0), command.at(1), command.at(2), command.at(3), data, Le);
+ QString statusWord = responseBytes.size() >= 2 ? QString(responseBytes.right(2).toHex()).toUpper() : QString("none");
+ //Names are prefixed with trace order, because vendor commands list is loaded in key order
+ QString name = QString("%1 INS %2 SW %3").arg(++commandsCount, 10, 10, QChar('0'))
+  .arg(QString::number(apdu.getIns(), 16).rightJustified(2, '0').toUpper()).arg(statusWord);
+ QJsonObject APDUObject;
+ APDUObject["CLA"] = QString::number(apdu.getClass(), 16);
+ APDUObject["INS"] = QString::number(apdu.getIns(), 16);
+ APDUObject["P1"] = QString::number(apdu.getP1(), 16);
+ APDUObject["P2"] = QString::number(apdu.getP2(), 16);
+ APDUObject["Le"] = QString::number(apdu.getLe(), 16);
+ APDUObject["Data"] = QString(apdu.getData().toHex());
+ //Entries are written right away, so memory usage doesn't grow with count of commands
+ vendorFile.write(commandsCount > 1 ? ",\n    \"" : "\n    \"");
+ vendorFile.write(name.toUtf8());
+ vendorFile.write("\": ");
+ vendorFile.write(QJsonDocument(APDUObject).toJson(QJsonDocument::Compact));
+}
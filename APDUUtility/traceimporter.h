@@ -0,0 +1,100 @@
+//! \file traceimporter.h
+//! \brief Header file for PC/SC, CCID trace logs and USB captures importer class.
+#ifndef TRACEIMPORTER_H
+#define TRACEIMPORTER_H
+
+#include <QFile>
+#include <QObject>
+#include <QSaveFile>
+#include <QSet>
+#include "nativescard.h"
+
+//! \class TraceImporter
+//! \brief Imports APDU commands from pcscd and libccid debug logs and USB captures into vendor commands list.
+//! \details Trace file is read in a single pass, through memory mapped windows for text logs and record by record for captures,
+//! so memory usage does not depend on trace size.
+//! Recognized text lines are pcscd "APDU:"/"SW:" pairs and libccid "->"/"<-" PC_to_RDR_XfrBlock/RDR_to_PC_DataBlock pairs.
+//! Binary pcap and pcapng captures of USBPcap and usbmon are recognized by file magic, their bulk transfers carrying
+//! PC_to_RDR_XfrBlock/RDR_to_PC_DataBlock messages are paired the same way as libccid lines.
+//! Commands are de-duplicated by hash of command bytes and written to vendor file as soon as they are accepted, only hashes are kept in memory.
+//! CCID frames are expected to carry short APDUs: readers exchanging TPDUs or extended APDUs in chained frames are not supported.
+//! Intended to be moved into worker thread and started by run() slot.
+class TraceImporter : public QObject
+{
+ Q_OBJECT
+public:
+ //!\brief Constructor
+ //!\param[in] traceFilePath path to trace log file.
+ //!\param[in] vendorFilePath path to vendor commands list json-file to write.
+ //!\param[in] parent Parent object, default is zero.
+ TraceImporter(const QString& traceFilePath, const QString& vendorFilePath, QObject *parent = 0);
+public slots:
+ //! \fn void TraceImporter::run(void)
+ //! \brief Parse trace file and write vendor commands list. Emits finished() or failed() when done.
+ void run(void);
+signals:
+ //! \fn void TraceImporter::progress(int percent)
+ //! \brief Emitted when percent of parsed trace file changed.
+ void progress(int percent);
+ //! \fn void TraceImporter::finished(int commandsCount, int duplicatesCount)
+ //! \brief Emitted when vendor commands list is written.
+ //! \param[in] commandsCount count of unique commands written.
+ //! \param[in] duplicatesCount count of skipped duplicate commands.
+ void finished(int commandsCount, int duplicatesCount);
+ //! \fn void TraceImporter::failed(const QString& err)
+ //! \brief Emitted when import failed or was interrupted.
+ //! \param[in] err error string.
+ void failed(const QString& err);
+private:
+ //! \fn bool TraceImporter::parseText(QFile& traceFile)
+ //! \brief Parse text log line by line.
+ //! \return false if import failed or was interrupted, failed() is emitted.
+ bool parseText(QFile& traceFile);
+ //! \fn bool TraceImporter::parsePcap(QFile& traceFile)
+ //! \brief Parse pcap capture record by record.
+ //! \return false if import failed or was interrupted, failed() is emitted.
+ bool parsePcap(QFile& traceFile);
+ //! \fn bool TraceImporter::parsePcapng(QFile& traceFile)
+ //! \brief Parse pcapng capture block by block.
+ //! \return false if import failed or was interrupted, failed() is emitted.
+ bool parsePcapng(QFile& traceFile);
+ //! \fn void TraceImporter::parseUsbPacket(quint32 linkType, bool bigEndian, const char *data, int length)
+ //! \brief Parse captured USB packet, bulk transfers with CCID message are passed to parseCcidFrame().
+ //! \param[in] linkType pcap link type of packet.
+ //! \param[in] bigEndian byte order of capture.
+ //! \param[in] data packet data with USBPcap or usbmon header.
+ //! \param[in] length captured length of packet.
+ void parseUsbPacket(quint32 linkType, bool bigEndian, const char *data, int length);
+ //! \fn void TraceImporter::parseCcidFrame(bool sent)
+ //! \brief Pair CCID message in response buffer with pending command.
+ //! \param[in] sent message is sent to reader.
+ void parseCcidFrame(bool sent);
+ //! \fn void TraceImporter::parseLine(const char *begin, const char *end)
+ //! \brief Parse one trace line without line terminator.
+ void parseLine(const char *begin, const char *end);
+ //! \fn bool TraceImporter::reportProgress(qint64 position, qint64 size)
+ //! \brief Emits progress() if percent changed.
+ //! \return false if interruption of import is requested.
+ bool reportProgress(qint64 position, qint64 size);
+ //! \fn bool TraceImporter::parseHex(const char *begin, const char *end, QByteArray& bytes) const
+ //! \brief Parse space separated hex bytes into reusable buffer.
+ //! \return false if non-hex token found.
+ bool parseHex(const char *begin, const char *end, QByteArray& bytes) const;
+ //! \fn void TraceImporter::addCommand(const QByteArray& responseBytes)
+ //! \brief Write pending command with its response into vendor file, if it is not a duplicate.
+ void addCommand(const QByteArray& responseBytes);
+ QString traceFilePath;//!< Path to trace log file
+ QSaveFile vendorFile;//!< Vendor commands list json-file, committed when import is finished
+ QByteArray lineBuffer;//!< Line crossing mapped window boundary
+ QByteArray packet;//!< Capture record buffer
+ QByteArray command;//!< Pending command bytes
+ QByteArray response;//!< Response bytes buffer
+ bool commandPending{ false };//!< Pending command waits response flag
+ char commandSequence{ 0 };//!< bSeq of pending CCID command
+ QSet<quint64> commandHashes;//!< Hashes of imported commands
+ int commandsCount{ 0 };//!< Count of written commands
+ int lastPercent{ -1 };//!< Last reported percent of parsed trace file
+ int duplicatesCount{ 0 };//!< Count of skipped duplicate commands
+};
+
+#endif // TRACEIMPORTER_H